@@ -1,7 +1,9 @@
 #ifndef CILK_H
 #define CILK_H
 
+#ifndef __USE_XOPEN
 #define __USE_XOPEN
+#endif
 #include <sys/types.h>
 
 #include <pthread.h>
@@ -11,6 +13,31 @@ struct cilk_thread {
     pthread_t * pthread;
 };
 
+/// Runs `f(arg)` under the model checker. Configured from the environment:
+///
+/// - `CILK_STRATEGY`: `random` (default), `fuzz`, or `dfs` for an exhaustive
+///   depth-first exploration.
+/// - `CILK_ITERATIONS`: number of executions (1 for `random`, 1000 for `fuzz`,
+///   unbounded for `dfs`).
+/// - `CILK_SYMMETRY`: `off` (default), `arg` or `routine`. Treats threads
+///   that have not run yet and were spawned with the same start routine (and,
+///   for `arg`, the same argument pointer) as interchangeable, so only one of
+///   them is a choice. Only sound because `cilk_join` cannot tell spawned
+///   threads apart; the preload library refuses it, as `pthread_join` can.
+/// - `CILK_SEED`: seed for the scheduler's random choices.
+/// - `CILK_CORPUS`: directory the fuzzing corpus is loaded from and saved to.
+///   Schedules that fail an assertion are saved there as `crash-*`.
+/// - `CILK_REPLAY`: schedule file to replay in the first execution.
+/// - `CILK_CHECKPOINT`: file the `dfs` frontier is written to every
+///   `CILK_CHECKPOINT_INTERVAL` (1000) executions and when the run stops.
+/// - `CILK_RESUME`: checkpoint to continue a `dfs` exploration from.
+/// - `CILK_SHARD`: `k/n`, resumes only the k-th of n contiguous runs of the
+///   branches left in the checkpoint, to split an exploration across jobs.
+///
+/// Unmodified pthread programs can be checked without calling this directly by
+/// running them with `LD_PRELOAD=libcilk-preload.so`, which runs `main` under
+/// `cilk_model` and models `pthread_create`, `pthread_join`, `pthread_exit`,
+/// mutexes, condition variables and `usleep`.
 void cilk_model(void (* f)(void *), void * arg);
 
 int cilk_spawn(
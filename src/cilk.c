@@ -1,10 +1,40 @@
+#define _POSIX_C_SOURCE 200809L
+
+#ifdef CILK_PRELOAD
+#define _GNU_SOURCE
+
+// The runtime's own threads and synchronisation must bypass the
+// interposers at the end of this file.
+#define pthread_create cilk_real_pthread_create
+#define pthread_join cilk_real_pthread_join
+#define pthread_exit cilk_real_pthread_exit
+#define pthread_mutex_init cilk_real_pthread_mutex_init
+#define pthread_mutex_destroy cilk_real_pthread_mutex_destroy
+#define pthread_mutex_lock cilk_real_pthread_mutex_lock
+#define pthread_mutex_trylock cilk_real_pthread_mutex_trylock
+#define pthread_mutex_unlock cilk_real_pthread_mutex_unlock
+#define pthread_cond_init cilk_real_pthread_cond_init
+#define pthread_cond_destroy cilk_real_pthread_cond_destroy
+#define pthread_cond_wait cilk_real_pthread_cond_wait
+#define pthread_cond_timedwait cilk_real_pthread_cond_timedwait
+#define pthread_cond_signal cilk_real_pthread_cond_signal
+#define pthread_cond_broadcast cilk_real_pthread_cond_broadcast
+#define usleep cilk_real_usleep
+#endif
+
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "cilk.h"
 
@@ -30,6 +60,7 @@ static bool queued_spawn_vec_pop(struct queued_spawn_vec *, struct queued_spawn
 
 struct decision_point {
     size_t num_choices;
+    size_t choice;
 };
 
 static void decision_point_init(struct decision_point *);
@@ -45,6 +76,7 @@ static void decision_point_vec_init(struct decision_point_vec *);
 static void decision_point_vec_drop(struct decision_point_vec *);
 static void decision_point_vec_grow(struct decision_point_vec *);
 static void decision_point_vec_push(struct decision_point_vec *, struct decision_point);
+static void decision_point_vec_clone(struct decision_point_vec *, const struct decision_point_vec *);
 
 struct execution {
     struct decision_point_vec decision_points;
@@ -53,6 +85,10 @@ struct execution {
 static void execution_init(struct execution *);
 static void execution_drop(struct execution *);
 
+static uint64_t execution_hash(const struct execution *);
+static bool execution_save(const struct execution *, const char * path);
+static bool execution_load(struct execution *, const char * path);
+
 struct execution_vec {
     size_t len;
     size_t cap;
@@ -65,68 +101,235 @@ static void execution_vec_drop(struct execution_vec *);
 static void execution_vec_grow(struct execution_vec *);
 static void execution_vec_push(struct execution_vec *, struct execution);
 
+/// Stateless depth-first explorer.
+///
+/// Schedules are explored in lexicographic order of their choices, so the
+/// whole frontier is the next prefix to replay: every branch not taken yet is
+/// a later choice at one of its depths. Every execution replays that prefix
+/// and then always takes the first choice.
+struct explorer {
+    /// Next prefix to replay, unless `is_exhausted`.
+    struct execution next;
+    bool is_exhausted;
+    /// First prefix past the end of a shard, or empty to explore to the end.
+    struct execution stop;
+
+    /// File the frontier is checkpointed to every `checkpoint_interval`
+    /// executions, or `NULL`.
+    const char * checkpoint_path;
+    size_t checkpoint_interval;
+};
+
+static void explorer_init(struct explorer *);
+static void explorer_drop(struct explorer *);
+
+static void explorer_advance(struct explorer *, const struct execution *);
+static size_t explorer_pending(const struct explorer *);
+static bool explorer_save(const struct explorer *);
+static bool explorer_load(struct explorer *, const char * path, size_t shard, size_t shards);
+
+#define COVERAGE_MAP_SIZE (1 << 16)
+
+/// Coverage-guided schedule fuzzer.
+///
+/// Every execution replays a mutated schedule from the corpus. Schedules that
+/// reach a new (thread, program point) pair, or a new transition between two
+/// such pairs, are added to the corpus.
+struct fuzzer {
+    /// Directory the corpus is loaded from and saved to, or `NULL`.
+    const char * corpus_dir;
+    struct execution_vec corpus;
+    /// Number of schedules loaded from `corpus_dir`, and the next one of
+    /// them to replay.
+    size_t seeds;
+    size_t next_seed;
+    bool replaying_seed;
+
+    uint8_t * coverage;
+    size_t prev_location;
+    bool new_coverage;
+};
+
+static void fuzzer_init(struct fuzzer *, const char * corpus_dir);
+static void fuzzer_drop(struct fuzzer *);
+
+static void fuzzer_load_corpus(struct fuzzer *);
+static void fuzzer_mutate(struct fuzzer *, struct execution * replay);
+static void fuzzer_cover(struct fuzzer *, size_t thread_id, uintptr_t pc);
+#ifdef CILK_PRELOAD
+static void fuzzer_cover_lock_order(struct fuzzer *, const void * prev, const void * next);
+#endif
+static void fuzzer_feedback(struct fuzzer *, const struct execution *);
+
 enum thread_state {
     THREAD_STATE_RUNNING,
     THREAD_STATE_PAUSED,
     THREAD_STATE_TERMINATED,
     THREAD_STATE_WAITING,
-    THREAD_STATE_JOINING
+    THREAD_STATE_JOINING,
+    /// Waiting for the scheduler to start the thread it just created.
+    THREAD_STATE_FORKING
 };
 
+/// What a paused thread waits for before the scheduler may resume it.
+enum thread_block {
+    THREAD_BLOCK_NONE,
+    /// `blocked_on` is the `struct thread` being joined.
+    THREAD_BLOCK_JOIN,
+    /// `blocked_on` is a mutex that must be unlocked.
+    THREAD_BLOCK_MUTEX,
+    /// `blocked_on` is a condition variable that must be signalled.
+    THREAD_BLOCK_COND,
+    /// Like `THREAD_BLOCK_COND`, but may also time out once `cond_mutex` is
+    /// unlocked.
+    THREAD_BLOCK_COND_TIMED
+};
+
+#define CACHE_LINE_SIZE 64
+
+/// Number of thread control blocks allocated at a time.
+#define THREAD_CHUNK_LEN 64
+
+/// Thread control block. Each one lives in its own cache line(s) inside the
+/// scheduler's thread table so that threads pausing and resuming never
+/// contend on each other's lines, and the scheduler scan is a linear walk.
 struct thread {
+    alignas(CACHE_LINE_SIZE) _Atomic enum thread_state state;
     size_t id;
-    enum thread_state * state;
     size_t parent;
 
-    pthread_mutex_t * pause_mu;
-    pthread_cond_t * pause_cond;
+    /// Start routine and argument the thread was spawned with.
+    void * (* routine)(void *);
+    const void * arg;
+
+    /// Where the thread paused, i.e. where it continues when resumed.
+    uintptr_t pc;
+    /// Number of times the scheduler resumed the thread.
+    size_t steps;
+
+    enum thread_block block;
+    const void * blocked_on;
+    const void * cond_mutex;
+    /// Last mutex the thread acquired, for lock order coverage.
+    const void * last_mutex;
+
+    /// Set by the scheduler for a `THREAD_STATE_FORKING` parent.
+    struct thread * forked;
+    pthread_t pthread;
+    void * ret;
+
+    pthread_mutex_t pause_mu;
+    pthread_cond_t pause_cond;
 
-    pthread_mutex_t * resume_mu;
-    pthread_cond_t * resume_cond;
+    pthread_mutex_t resume_mu;
+    pthread_cond_t resume_cond;
 };
 
+static void thread_init(struct thread *, size_t id, size_t parent, void * (* routine)(void *), const void * arg);
 static void thread_drop(struct thread *);
+static void thread_terminate(struct thread *);
 
-struct thread_vec {
-    size_t len;
+struct thread_chunk {
+    struct thread items[THREAD_CHUNK_LEN];
+};
+
+/// Chunk pointers of a thread table. A full directory is replaced by a
+/// larger copy, but other threads may still be reading the old one, so it is
+/// kept in `prev` until the table is dropped.
+struct thread_directory {
+    struct thread_directory * prev;
     size_t cap;
-    struct thread * items;
+    struct thread_chunk * chunks[];
 };
 
-static void thread_vec_init(struct thread_vec *);
-static void thread_vec_drop(struct thread_vec *);
+/// Table of thread control blocks, allocated in cache-aligned chunks. Slots
+/// never move once claimed, so threads can keep a pointer to their own block,
+/// and chunks are kept across executions.
+struct thread_table {
+    atomic_size_t len;
+    _Atomic(struct thread_directory *) directory;
+    /// Number of chunks allocated so far.
+    size_t chunks_len;
+};
 
-static void thread_vec_grow(struct thread_vec *);
-static void thread_vec_push(struct thread_vec *, struct thread);
+static void thread_table_init(struct thread_table *);
+static void thread_table_drop(struct thread_table *);
+static void thread_table_clear(struct thread_table *);
+static struct thread * thread_table_get(struct thread_table *, size_t id);
+
+static struct thread * thread_table_claim(
+    struct thread_table *,
+    size_t parent,
+    void * (* routine)(void *),
+    const void * arg
+);
+
+/// The calling thread's control block, or `NULL` if it is not modelled.
+static __thread struct thread * CTX = NULL;
+
+/// Model-side state of a user mutex, keyed by its address. Modelled threads
+/// never lock the real mutex.
+struct sync_mutex {
+    const void * addr;
+    bool locked;
+    size_t owner;
+};
 
-struct thread_context {
-    enum thread_state * state;
+struct sync_mutex_vec {
+    size_t len;
+    size_t cap;
+    struct sync_mutex * items;
+};
 
-    pthread_mutex_t * pause_mu;
-    pthread_cond_t * pause_cond;
+static void sync_mutex_vec_init(struct sync_mutex_vec *);
+static void sync_mutex_vec_drop(struct sync_mutex_vec *);
+static void sync_mutex_vec_grow(struct sync_mutex_vec *);
+static struct sync_mutex * sync_mutex_vec_get(struct sync_mutex_vec *, const void * addr);
 
-    pthread_mutex_t * resume_mu;
-    pthread_cond_t * resume_cond;
+enum strategy {
+    STRATEGY_RANDOM,
+    STRATEGY_FUZZ,
+    STRATEGY_DFS
 };
 
-static __thread struct thread_context * CTX = NULL;
-static __thread pthread_once_t CTX_INIT_ONCE = PTHREAD_ONCE_INIT;
-
-static void thread_context_init_once(void);
-static struct thread_context * thread_context(void);
+/// Which threads are considered interchangeable, selected with `CILK_SYMMETRY`.
+enum symmetry {
+    SYMMETRY_OFF,
+    /// Same start routine and same argument pointer.
+    SYMMETRY_ARG,
+    /// Same start routine; the caller vouches that the arguments are equivalent.
+    SYMMETRY_ROUTINE
+};
 
-static void thread_context_init(struct thread_context *);
-static void thread_context_drop(struct thread_context *);
+static bool thread_is_symmetric(const struct thread *, const struct thread *, enum symmetry);
 
 struct scheduler {
-    struct thread_vec threads;
+    /// Selected with `CILK_STRATEGY`.
+    enum strategy strategy;
+    enum symmetry symmetry;
+    /// Number of executions to run, `CILK_ITERATIONS`.
+    size_t iterations;
+
+    /// Choices to replay at the start of the current execution.
+    struct execution replay;
+    /// Whether the program must reach `replay`'s decision points exactly, as
+    /// for `CILK_REPLAY` and DFS prefixes; fuzz schedules may diverge.
+    bool replay_is_exact;
+    struct fuzzer fuzzer;
+    struct explorer explorer;
+
+    struct thread_table threads;
     struct execution * execution;
-    struct execution_vec executions;
+    size_t executions_len;
 
     /// `cilk_spawn()` queues up the spawns here.
     struct queued_spawn_vec queued_spawns;
-    size_t queued_spawn_batch_size;
-    atomic_int queued_spawn_batch_count;
+
+    /// Scratch buffer of candidate thread indices, reused at every decision.
+    size_t * candidates;
+    size_t candidates_cap;
+
+    struct sync_mutex_vec mutexes;
 
     pthread_t * pthreads;
     size_t pthreads_len;
@@ -134,6 +337,12 @@ struct scheduler {
     bool * wakeup;
     pthread_cond_t wakeup_cond;
     pthread_mutex_t wakeup_mu;
+
+#ifdef CILK_PRELOAD
+    /// Set when `main` calls `pthread_exit`, after which the process lives on
+    /// until its last thread ends.
+    bool main_exited;
+#endif
 };
 
 static struct scheduler * SCHEDULER = NULL;
@@ -142,19 +351,33 @@ static pthread_mutex_t SCHEDULER_MU = PTHREAD_MUTEX_INITIALIZER;
 static void scheduler_init(struct scheduler *);
 static void scheduler_drop(struct scheduler *);
 
-static bool scheduler_is_exhausted(struct scheduler);
+static void scheduler_execution_start(struct scheduler *);
+static void scheduler_execution_stop(struct scheduler *);
+static bool scheduler_is_exhausted(struct scheduler *);
+static size_t scheduler_choose(struct scheduler *, size_t num_choices);
+static size_t scheduler_decide(struct scheduler *, size_t num_choices);
+
+static bool scheduler_thread_is_enabled(struct scheduler *, const struct thread *);
+
+static void scheduler_save_failure(struct scheduler *, const struct execution *);
+
+static void on_abort(int);
 
 static void * run_scheduler(void *);
 
+static void run_execution(void (* f)(void *), void * arg);
+#ifdef CILK_PRELOAD
+static void run_execution_forked(void (* f)(void *), void * arg);
+#endif
 static void execute(void (* f)(void *), void * arg);
 
-static void cilk_pause(void);
-static void cilk_wait(void);
+static void cilk_pause(uintptr_t pc);
+static void cilk_wait(uintptr_t pc);
 
 struct run_cilk_thread_params {
     void * (* f)(void *);
     void * arg;
-    size_t parent;
+    struct thread * thread;
 };
 
 static void * run_cilk_thread(void * arg);
@@ -163,21 +386,36 @@ void cilk_model(void (* f)(void *), void * arg) {
     SCHEDULER = malloc(sizeof(struct scheduler));
     scheduler_init(SCHEDULER);
 
-    pthread_t scheduler_pthread;
-
-    int err = pthread_create(&scheduler_pthread, NULL, run_scheduler, NULL);
-    if (err) {
-        fprintf(stderr, "[cilk] Failed to spawn scheduler thread.\n");
-        exit(1);
+    while (!scheduler_is_exhausted(SCHEDULER)) {
+        scheduler_execution_start(SCHEDULER);
+#ifdef CILK_PRELOAD
+        // The program's globals are not ours to reset, so every execution
+        // runs in a fresh copy of the process.
+        run_execution_forked(f, arg);
+#else
+        run_execution(f, arg);
+#endif
+        scheduler_execution_stop(SCHEDULER);
     }
 
-    execute(f, arg);
+    if (SCHEDULER->strategy == STRATEGY_FUZZ) {
+        fprintf(
+            stderr,
+            "[cilk] Fuzzing done: %zu execution(s), corpus of %zu schedule(s).\n",
+            SCHEDULER->executions_len,
+            SCHEDULER->fuzzer.corpus.len
+        );
+    }
 
-    for (size_t i = 0; i < SCHEDULER->pthreads_len; i++) {
-        pthread_join(SCHEDULER->pthreads[i], NULL);
+    if (SCHEDULER->strategy == STRATEGY_DFS) {
+        fprintf(
+            stderr,
+            "[cilk] Exploration stopped: %zu execution(s), %zu unexplored branch(es).\n",
+            SCHEDULER->executions_len,
+            explorer_pending(&SCHEDULER->explorer)
+        );
     }
 
-    pthread_join(scheduler_pthread, NULL);
     scheduler_drop(SCHEDULER);
     free(SCHEDULER);
 }
@@ -187,7 +425,7 @@ int cilk_spawn(
     void * (* start_routine)(void *),
     void * arg
 ) {
-    cilk_pause();
+    cilk_pause((uintptr_t) __builtin_return_address(0));
 
     struct queued_spawn spawn;
     queued_spawn_init(&spawn, start_routine, arg);
@@ -197,13 +435,13 @@ int cilk_spawn(
 }
 
 int cilk_join(struct cilk_thread thread, void ** ret) {
-    cilk_wait();
+    cilk_wait((uintptr_t) __builtin_return_address(0));
 
     return 0;
 }
 
 void cilk_usleep(useconds_t usec) {
-    cilk_pause();
+    cilk_pause((uintptr_t) __builtin_return_address(0));
 }
 
 static void queued_spawn_init(struct queued_spawn * self, void * (* f)(void *), void * arg) {
@@ -287,6 +525,11 @@ static void decision_point_vec_push(struct decision_point_vec * self, struct dec
     self->len += 1;
 }
 
+static void decision_point_vec_clone(struct decision_point_vec * self, const struct decision_point_vec * other) {
+    for (size_t i = 0; i < other->len; i++)
+        decision_point_vec_push(self, other->items[i]);
+}
+
 static void execution_init(struct execution * self) {
     decision_point_vec_init(&self->decision_points);
 }
@@ -295,6 +538,58 @@ static void execution_drop(struct execution * self) {
     decision_point_vec_drop(&self->decision_points);
 }
 
+static uint64_t execution_hash(const struct execution * self) {
+    // FNV-1a over the choices.
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (size_t i = 0; i < self->decision_points.len; i++) {
+        hash ^= self->decision_points.items[i].choice;
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+/// Writes the schedule as one `choice/num_choices` line per decision point.
+static bool execution_save(const struct execution * self, const char * path) {
+    FILE * file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    for (size_t i = 0; i < self->decision_points.len; i++) {
+        const struct decision_point * point = &self->decision_points.items[i];
+
+        fprintf(file, "%zu/%zu\n", point->choice, point->num_choices);
+    }
+
+    return fclose(file) == 0;
+}
+
+static bool execution_load(struct execution * self, const char * path) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    bool is_valid = true;
+
+    struct decision_point point;
+    while (fscanf(file, "%zu/%zu", &point.choice, &point.num_choices) == 2) {
+        if (point.choice >= point.num_choices) {
+            is_valid = false;
+            break;
+        }
+
+        decision_point_vec_push(&self->decision_points, point);
+    }
+
+    // Anything but trailing whitespace left unread is a malformed point.
+    int c;
+    do c = fgetc(file); while (c == ' ' || c == '\n');
+    is_valid = is_valid && c == EOF;
+
+    fclose(file);
+
+    return is_valid;
+}
+
 static void execution_vec_init(struct execution_vec * self) {
     self->len = 0;
     self->cap = 0;
@@ -326,352 +621,1636 @@ static void execution_vec_push(struct execution_vec * self, struct execution ite
     self->len += 1;
 }
 
-static void thread_drop(struct thread * self) {
+static void explorer_init(struct explorer * self) {
+    execution_init(&self->next);
+    self->is_exhausted = false;
+    execution_init(&self->stop);
+    self->checkpoint_path = NULL;
+    self->checkpoint_interval = 0;
 }
 
-static void thread_vec_init(struct thread_vec * self) {
-    self->len = 0;
-    self->cap = 0;
-    self->items = NULL;
+static void explorer_drop(struct explorer * self) {
+    execution_drop(&self->next);
+    execution_drop(&self->stop);
 }
 
-static void thread_vec_drop(struct thread_vec * self) {
-    for (size_t i = 0; i < self->len; i++)
-        thread_drop(&self->items[i]);
+/// Orders prefixes by their choices, a prefix before its extensions.
+static int prefix_compare(const struct decision_point_vec * a, const struct decision_point_vec * b) {
+    for (size_t i = 0; i < a->len && i < b->len; i++) {
+        if (a->items[i].choice != b->items[i].choice)
+            return a->items[i].choice < b->items[i].choice ? -1 : 1;
+    }
 
-    free(self->items);
+    return (a->len > b->len) - (a->len < b->len);
 }
 
-static void thread_vec_grow(struct thread_vec * self) {
-    self->cap *= 2;
+/// Parses a line of space-separated `choice/num_choices` points.
+static bool prefix_parse(struct decision_point_vec * self, const char * line) {
+    struct decision_point point;
+    int consumed;
+    const char * cursor = line;
 
-    if (self->cap == 0) self->cap = 1;
+    for (; sscanf(cursor, "%zu/%zu%n", &point.choice, &point.num_choices, &consumed) == 2; cursor += consumed) {
+        if (point.choice >= point.num_choices) return false;
 
-    self->items = realloc(self->items, self->cap * sizeof(struct thread));
+        decision_point_vec_push(self, point);
+    }
+
+    cursor += strspn(cursor, " \n");
+
+    return *cursor == '\0';
 }
 
-static void thread_vec_push(struct thread_vec * self, struct thread item) {
-    if (self->len == self->cap) {
-        thread_vec_grow(self);
-    }
+static void prefix_write(const struct decision_point_vec * self, FILE * file) {
+    for (size_t i = 0; i < self->len; i++)
+        fprintf(file, i == 0 ? "%zu/%zu" : " %zu/%zu", self->items[i].choice, self->items[i].num_choices);
 
-    self->items[self->len] = item;
-    self->len += 1;
+    fputc('\n', file);
 }
 
-static void thread_context_init_once(void) {
-    if (CTX != NULL) {
+/// Moves on to the deepest branch `execution` passed by without taking it.
+static void explorer_advance(struct explorer * self, const struct execution * execution) {
+    struct decision_point_vec * next = &self->next.decision_points;
+
+    next->len = 0;
+    decision_point_vec_clone(next, &execution->decision_points);
+
+    while (next->len > 0 && next->items[next->len - 1].choice + 1 == next->items[next->len - 1].num_choices)
+        next->len -= 1;
+
+    if (next->len == 0) {
+        self->is_exhausted = true;
         return;
     }
 
-    CTX = malloc(sizeof(struct thread_context));
-    thread_context_init(CTX);
+    next->items[next->len - 1].choice += 1;
+
+    if (self->stop.decision_points.len > 0 && prefix_compare(next, &self->stop.decision_points) >= 0)
+        self->is_exhausted = true;
 }
 
-static struct thread_context * thread_context(void) {
-    pthread_once(&CTX_INIT_ONCE, thread_context_init_once);
+/// Builds the root of the `index`-th subtree left to explore, in the order
+/// they are explored: the next prefix itself, then the untried choices at each
+/// of its depths, deepest first. Returns false past the last one.
+static bool explorer_unit(const struct explorer * self, size_t index, struct decision_point_vec * root) {
+    if (self->is_exhausted) return false;
 
-    return CTX;
-}
+    const struct decision_point_vec * next = &self->next.decision_points;
+    root->len = 0;
+
+    if (index == 0) {
+        decision_point_vec_clone(root, next);
+        return true;
+    }
+
+    index -= 1;
 
-static void thread_context_init(struct thread_context * self) {
-    self->state = malloc(sizeof(enum thread_state));
-    *self->state = THREAD_STATE_RUNNING;
+    for (size_t depth = next->len; depth-- > 0;) {
+        const struct decision_point * point = &next->items[depth];
+        size_t untried = point->num_choices - point->choice - 1;
 
-    self->pause_mu = malloc(sizeof(pthread_mutex_t));
-    self->pause_cond = malloc(sizeof(pthread_cond_t));
+        if (index < untried) {
+            for (size_t i = 0; i < depth; i++)
+                decision_point_vec_push(root, next->items[i]);
 
-    pthread_mutex_init(self->pause_mu, NULL);
-    pthread_cond_init(self->pause_cond, NULL);
+            decision_point_vec_push(root, (struct decision_point) {
+                .num_choices = point->num_choices,
+                .choice = point->choice + 1 + index,
+            });
 
-    self->resume_mu = malloc(sizeof(pthread_mutex_t));
-    self->resume_cond = malloc(sizeof(pthread_cond_t));
+            return self->stop.decision_points.len == 0 || prefix_compare(root, &self->stop.decision_points) < 0;
+        }
+
+        index -= untried;
+    }
 
-    pthread_mutex_init(self->resume_mu, NULL);
-    pthread_cond_init(self->resume_cond, NULL);
+    return false;
 }
 
-static void thread_context_drop(struct thread_context * self) {
-    pthread_mutex_destroy(self->pause_mu);
-    pthread_cond_destroy(self->pause_cond);
+/// Number of subtrees left to explore, see `explorer_unit`.
+static size_t explorer_pending(const struct explorer * self) {
+    struct decision_point_vec root;
+    decision_point_vec_init(&root);
+
+    size_t pending = 0;
+    while (explorer_unit(self, pending, &root))
+        pending += 1;
 
-    pthread_mutex_destroy(self->resume_mu);
-    pthread_cond_destroy(self->resume_cond);
+    decision_point_vec_drop(&root);
 
-    free(self->state);
+    return pending;
 }
 
-static void scheduler_init(struct scheduler * self) {
-    thread_vec_init(&self->threads);
-    self->execution = NULL;
-    execution_vec_init(&self->executions);
-    queued_spawn_vec_init(&self->queued_spawns);
+/// Keeps the `shard`-th of `shards` contiguous runs of the subtrees left to
+/// explore.
+static void explorer_shard(struct explorer * self, size_t shard, size_t shards) {
+    size_t pending = explorer_pending(self);
+    size_t begin = pending * shard / shards;
+    size_t end = pending * (shard + 1) / shards;
 
-    self->pthreads = NULL;
-    self->wakeup = malloc(sizeof(bool));
-    *self->wakeup = false;
+    if (begin == end) {
+        self->is_exhausted = true;
+        return;
+    }
 
-    pthread_cond_init(&self->wakeup_cond, NULL);
-    pthread_mutex_init(&self->wakeup_mu, NULL);
+    struct decision_point_vec root;
+    decision_point_vec_init(&root);
+
+    if (end < pending) {
+        explorer_unit(self, end, &root);
+        self->stop.decision_points.len = 0;
+        decision_point_vec_clone(&self->stop.decision_points, &root);
+    }
+
+    explorer_unit(self, begin, &root);
+    self->next.decision_points.len = 0;
+    decision_point_vec_clone(&self->next.decision_points, &root);
+
+    decision_point_vec_drop(&root);
 }
 
-static void scheduler_drop(struct scheduler * self) {
-    pthread_cond_destroy(&self->wakeup_cond);
-    pthread_mutex_destroy(&self->wakeup_mu);
-    free(self->wakeup);
-    free(self->pthreads);
+/// Writes the next prefix and, for a shard, the stop prefix on a second line,
+/// in the `choice/num_choices` format of `execution_save`; an exhausted
+/// exploration writes nothing. Goes via a temporary file so that a preempted
+/// write never leaves a truncated checkpoint behind.
+static bool explorer_save(const struct explorer * self) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", self->checkpoint_path);
 
-    queued_spawn_vec_drop(&self->queued_spawns);
-    execution_vec_drop(&self->executions);
-    thread_vec_drop(&self->threads);
+    FILE * file = fopen(tmp_path, "w");
+    if (file == NULL) return false;
+
+    if (!self->is_exhausted) {
+        prefix_write(&self->next.decision_points, file);
+
+        if (self->stop.decision_points.len > 0)
+            prefix_write(&self->stop.decision_points, file);
+    }
+
+    if (fclose(file) != 0) return false;
+
+    return rename(tmp_path, self->checkpoint_path) == 0;
 }
 
-static void scheduler_execution_start(struct scheduler * self) {
-    self->execution = malloc(sizeof(struct execution));
-    execution_init(self->execution);
+/// Loads a checkpoint written by `explorer_save` and keeps the `shard`-th of
+/// `shards` parts of what is left.
+static bool explorer_load(struct explorer * self, const char * path, size_t shard, size_t shards) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char * line = NULL;
+    size_t line_cap = 0;
+    bool is_valid = true;
+
+    if (getline(&line, &line_cap, file) == -1) {
+        self->is_exhausted = true;
+    } else {
+        is_valid = prefix_parse(&self->next.decision_points, line);
+
+        if (is_valid && getline(&line, &line_cap, file) != -1)
+            is_valid = prefix_parse(&self->stop.decision_points, line) && getline(&line, &line_cap, file) == -1;
+
+        const struct decision_point_vec * stop = &self->stop.decision_points;
+        if (is_valid && stop->len > 0 && prefix_compare(&self->next.decision_points, stop) >= 0)
+            self->is_exhausted = true;
+    }
+
+    free(line);
+    fclose(file);
+
+    if (is_valid && shards > 1) explorer_shard(self, shard, shards);
+
+    return is_valid;
 }
 
-static void scheduler_execution_stop(struct scheduler * self) {
-    execution_vec_push(&self->executions, *self->execution);
-    free(self->execution);
-    self->execution = NULL;
+static void fuzzer_init(struct fuzzer * self, const char * corpus_dir) {
+    self->corpus_dir = corpus_dir;
+    execution_vec_init(&self->corpus);
+    self->seeds = 0;
+    self->next_seed = 0;
+    self->replaying_seed = false;
+
+    self->coverage = calloc(COVERAGE_MAP_SIZE, sizeof(uint8_t));
+    self->prev_location = 0;
+    self->new_coverage = false;
 }
 
-static bool scheduler_is_exhausted(struct scheduler self) {
-    return true;
+static void fuzzer_drop(struct fuzzer * self) {
+    free(self->coverage);
+    execution_vec_drop(&self->corpus);
 }
 
-static void * run_scheduler(void * arg) {
-    while (true) {
-        pthread_mutex_lock(&SCHEDULER->wakeup_mu);
-        while (!*SCHEDULER->wakeup)
-            pthread_cond_wait(&SCHEDULER->wakeup_cond, &SCHEDULER->wakeup_mu);
-        *SCHEDULER->wakeup = false;
-        pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+static void fuzzer_load_corpus(struct fuzzer * self) {
+    if (self->corpus_dir == NULL) return;
 
-        pthread_mutex_lock(&SCHEDULER_MU);
-        struct thread_vec threads = SCHEDULER->threads;
-        pthread_mutex_unlock(&SCHEDULER_MU);
+    DIR * dir = opendir(self->corpus_dir);
+    if (dir == NULL) return;
 
-        for (size_t i = 0; i < threads.len; i++) {
-            struct thread * thread = &threads.items[i];
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Failing schedules are kept next to the corpus but are not seeds.
+        if (strncmp(entry->d_name, "schedule-", strlen("schedule-")) != 0) continue;
 
-            pthread_mutex_lock(thread->pause_mu);
-            while (*thread->state == THREAD_STATE_RUNNING) {
-                pthread_cond_wait(thread->pause_cond, thread->pause_mu);
-            }
-            pthread_mutex_unlock(thread->pause_mu);
-        }
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", self->corpus_dir, entry->d_name);
 
-        // Now all threads are not running.
-        bool all_threads_terminated = true;
-        for (size_t i = 0; i < threads.len; i++) {
-            if (*threads.items[i].state != THREAD_STATE_TERMINATED) {
-                all_threads_terminated = false;
-                break;
-            }
+        struct execution seed;
+        execution_init(&seed);
+
+        if (execution_load(&seed, path)) {
+            execution_vec_push(&self->corpus, seed);
+        } else {
+            fprintf(stderr, "[cilk] Skipping malformed schedule %s.\n", path);
+            execution_drop(&seed);
         }
+    }
 
-        if (all_threads_terminated) break;
+    closedir(dir);
 
-        bool new_spawns = false;
+    self->seeds = self->corpus.len;
+    fprintf(stderr, "[cilk] Loaded %zu schedule(s) from %s.\n", self->seeds, self->corpus_dir);
+}
 
-        // Check if any parent thread is waiting (joining).
-        // If so, we need to spawn the threads.
-        for (size_t i = 0; i < threads.len; i++) {
-            struct thread * t = &threads.items[i];
+static void fuzzer_mutate(struct fuzzer * self, struct execution * replay) {
+    // Replay the loaded corpus as-is first to rebuild the coverage map.
+    if (self->next_seed < self->seeds) {
+        decision_point_vec_clone(&replay->decision_points, &self->corpus.items[self->next_seed].decision_points);
+        self->next_seed += 1;
+        self->replaying_seed = true;
 
-            if (*t->state == THREAD_STATE_WAITING) {
-                struct queued_spawn spawn;
+        return;
+    }
 
-                SCHEDULER->queued_spawn_batch_size = SCHEDULER->queued_spawns.len;
-                SCHEDULER->queued_spawn_batch_count = 0;
+    // With an empty corpus the first execution is purely random.
+    if (self->corpus.len == 0) return;
 
-                while (queued_spawn_vec_pop(&SCHEDULER->queued_spawns, &spawn)) {
-                    // Dispatch the queued spawn.
+    const struct execution * seed = &self->corpus.items[rand() % self->corpus.len];
+    decision_point_vec_clone(&replay->decision_points, &seed->decision_points);
 
-                    fprintf(stderr, "[cilk] Spawning queued thread...\n");
+    struct decision_point_vec * points = &replay->decision_points;
+    if (points->len == 0) return;
 
-                    struct run_cilk_thread_params * params = malloc(sizeof(struct run_cilk_thread_params));
+    size_t k = rand() % points->len;
+    struct decision_point * point = &points->items[k];
 
-                    *params = (struct run_cilk_thread_params) {
-                        .f = spawn.f,
-                        .arg = spawn.arg,
-                        .parent = t->id,
-                    };
+    if (point->num_choices > 1)
+        point->choice = (point->choice + 1 + rand() % (point->num_choices - 1)) % point->num_choices;
 
-                    pthread_t pthread;
+    // Either keep the seed's suffix or let it run randomly past the flip.
+    if (rand() % 2) points->len = k + 1;
+}
 
-                    int err = pthread_create(&pthread, NULL, run_cilk_thread, params);
-                    if (err) {
-                        fprintf(stderr, "[cilk] Failed to spawn queued thread.\n");
-                        exit(1);
-                    }
+static void fuzzer_cover(struct fuzzer * self, size_t thread_id, uintptr_t pc) {
+    uint64_t hash = (uint64_t) pc ^ (thread_id * 0x9e3779b97f4a7c15);
+    hash ^= hash >> 31;
+    hash *= 0xbf58476d1ce4e5b9;
+    hash ^= hash >> 29;
 
-                    SCHEDULER->pthreads_len += 1;
-                    SCHEDULER->pthreads = realloc(SCHEDULER->pthreads, SCHEDULER->pthreads_len * sizeof(pthread_t));
-                    SCHEDULER->pthreads[SCHEDULER->pthreads_len - 1] = pthread;
+    size_t location = hash % COVERAGE_MAP_SIZE;
+    size_t edge = (self->prev_location >> 1) ^ location;
 
-                    new_spawns = true;
-                }
+    if (!self->coverage[location] || !self->coverage[edge])
+        self->new_coverage = true;
 
-                while (SCHEDULER->queued_spawn_batch_count != SCHEDULER->queued_spawn_batch_size);
+    self->coverage[location] = 1;
+    self->coverage[edge] = 1;
+    self->prev_location = location;
+}
 
-                // Resume the waiting parent thread.
-                pthread_mutex_lock(t->resume_mu);
-                *t->state = THREAD_STATE_JOINING;
-                pthread_cond_signal(t->resume_cond);
-                pthread_mutex_unlock(t->resume_mu);
-            }
+#ifdef CILK_PRELOAD
+static void fuzzer_mark(struct fuzzer * self, uint64_t hash) {
+    hash ^= hash >> 31;
+    hash *= 0xbf58476d1ce4e5b9;
+    hash ^= hash >> 29;
+
+    size_t location = hash % COVERAGE_MAP_SIZE;
+
+    if (!self->coverage[location]) {
+        self->coverage[location] = 1;
+        self->new_coverage = true;
+    }
+}
+
+static void fuzzer_cover_lock_order(struct fuzzer * self, const void * prev, const void * next) {
+    fuzzer_mark(self, ((uint64_t) (uintptr_t) prev * 0x9e3779b97f4a7c15) ^ (uint64_t) (uintptr_t) next);
+}
+#endif
+
+static void fuzzer_feedback(struct fuzzer * self, const struct execution * execution) {
+    if (self->new_coverage && !self->replaying_seed) {
+        struct execution entry;
+        execution_init(&entry);
+        decision_point_vec_clone(&entry.decision_points, &execution->decision_points);
+        execution_vec_push(&self->corpus, entry);
+
+        if (self->corpus_dir != NULL) {
+            char path[4096];
+            snprintf(
+                path, sizeof(path), "%s/schedule-%016llx",
+                self->corpus_dir, (unsigned long long) execution_hash(&entry)
+            );
+
+            if (!execution_save(&entry, path))
+                fprintf(stderr, "[cilk] Failed to save schedule to %s.\n", path);
         }
+    }
 
-        if (new_spawns) continue;
+    self->prev_location = 0;
+    self->new_coverage = false;
+    self->replaying_seed = false;
+}
 
-        struct thread_vec candidates;
-        thread_vec_init(&candidates);
+static void thread_init(struct thread * self, size_t id, size_t parent, void * (* routine)(void *), const void * arg) {
+    atomic_init(&self->state, THREAD_STATE_RUNNING);
+    self->id = id;
+    self->parent = parent;
+    self->routine = routine;
+    self->arg = arg;
+    self->pc = 0;
+    self->steps = 0;
 
-        for (size_t i = 0; i < threads.len; i++) {
-            struct thread * t = &threads.items[i];
+    self->block = THREAD_BLOCK_NONE;
+    self->blocked_on = NULL;
+    self->cond_mutex = NULL;
+    self->last_mutex = NULL;
 
-            if (*t->state == THREAD_STATE_PAUSED) {
-                thread_vec_push(&candidates, *t);
-            }
-        }
+    self->forked = NULL;
+    self->ret = NULL;
 
-        if (candidates.len == 0) continue;
+    pthread_mutex_init(&self->pause_mu, NULL);
+    pthread_cond_init(&self->pause_cond, NULL);
 
-        size_t choice = rand() % candidates.len;
+    pthread_mutex_init(&self->resume_mu, NULL);
+    pthread_cond_init(&self->resume_cond, NULL);
+}
 
-        fprintf(stderr, "[cilk] Decision point with %zu choice(s). Picking idx %zu.\n", candidates.len, choice);
-        decision_point_vec_push(&SCHEDULER->execution->decision_points, (struct decision_point){
-            .num_choices = SCHEDULER->threads.len,
-        });
+static void thread_drop(struct thread * self) {
+    pthread_mutex_destroy(&self->pause_mu);
+    pthread_cond_destroy(&self->pause_cond);
 
+    pthread_mutex_destroy(&self->resume_mu);
+    pthread_cond_destroy(&self->resume_cond);
+}
 
-        // Unpause a thread.
+/// Two paused threads are symmetric if they were spawned alike by the same
+/// parent and neither has been resumed yet. Once a thread has run, its state
+/// is more than its program point, so it is never interchangeable.
+static bool thread_is_symmetric(const struct thread * a, const struct thread * b, enum symmetry symmetry) {
+    if (symmetry == SYMMETRY_OFF) return false;
 
-        struct thread * thread = &candidates.items[choice];
+    if (a->steps != 0 || b->steps != 0) return false;
+    if (a->routine != b->routine || a->parent != b->parent) return false;
 
-        pthread_mutex_lock(thread->resume_mu);
-        *thread->state = THREAD_STATE_RUNNING;
-        pthread_cond_signal(thread->resume_cond);
-        pthread_mutex_unlock(thread->resume_mu);
+    return symmetry == SYMMETRY_ROUTINE || a->arg == b->arg;
+}
 
-        thread_vec_drop(&candidates);
-    }
+static void sync_mutex_vec_init(struct sync_mutex_vec * self) {
+    self->len = 0;
+    self->cap = 0;
+    self->items = NULL;
+}
 
-    return NULL;
+static void sync_mutex_vec_drop(struct sync_mutex_vec * self) {
+    free(self->items);
 }
 
-static void execute(void (* f)(void *), void * arg) {
-    struct thread_context * ctx = thread_context();
+static void sync_mutex_vec_grow(struct sync_mutex_vec * self) {
+    self->cap *= 2;
 
-    pthread_mutex_lock(&SCHEDULER_MU);
-    scheduler_execution_start(SCHEDULER);
-    thread_vec_push(&SCHEDULER->threads, (struct thread) {
-        .id = 0,
-        .state = ctx->state,
-        .pause_mu = ctx->pause_mu,
-        .pause_cond = ctx->pause_cond,
-        .resume_cond = ctx->resume_cond,
-        .resume_mu = ctx->resume_mu,
-    });
-    pthread_mutex_unlock(&SCHEDULER_MU);
+    if (self->cap == 0) self->cap = 1;
 
-    (f)(arg);
+    self->items = realloc(self->items, self->cap * sizeof(struct sync_mutex));
+}
 
-    *SCHEDULER->threads.items[0].state = THREAD_STATE_TERMINATED;
+/// Looks up the state of the mutex at `addr`, creating an unlocked one for
+/// mutexes that were statically initialized.
+static struct sync_mutex * sync_mutex_vec_get(struct sync_mutex_vec * self, const void * addr) {
+    for (size_t i = 0; i < self->len; i++) {
+        if (self->items[i].addr == addr) return &self->items[i];
+    }
 
-    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
-    *SCHEDULER->wakeup = true;
-    pthread_cond_signal(&SCHEDULER->wakeup_cond);
-    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+    if (self->len == self->cap)
+        sync_mutex_vec_grow(self);
+
+    self->items[self->len] = (struct sync_mutex) {
+        .addr = addr,
+        .locked = false,
+        .owner = 0,
+    };
+    self->len += 1;
+
+    return &self->items[self->len - 1];
 }
 
-static inline void cilk_pause(void) {
-    struct thread_context * ctx = thread_context();
+static void thread_table_init(struct thread_table * self) {
+    atomic_init(&self->len, 0);
+    atomic_init(&self->directory, NULL);
+    self->chunks_len = 0;
+}
 
-    pthread_mutex_lock(ctx->pause_mu);
-    assert(*ctx->state == THREAD_STATE_RUNNING);
-    *ctx->state = THREAD_STATE_PAUSED;
-    pthread_cond_signal(ctx->pause_cond);
-    pthread_mutex_unlock(ctx->pause_mu);
+static void thread_table_drop(struct thread_table * self) {
+    thread_table_clear(self);
 
-    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
-    *SCHEDULER->wakeup = true;
-    pthread_cond_signal(&SCHEDULER->wakeup_cond);
-    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+    struct thread_directory * directory = atomic_load(&self->directory);
+
+    for (size_t i = 0; i < self->chunks_len; i++)
+        free(directory->chunks[i]);
 
-    pthread_mutex_lock(ctx->resume_mu);
-    while (*ctx->state == THREAD_STATE_PAUSED) {
-        pthread_cond_wait(ctx->resume_cond, ctx->resume_mu);
+    while (directory != NULL) {
+        struct thread_directory * prev = directory->prev;
+        free(directory);
+        directory = prev;
     }
-    assert(*ctx->state == THREAD_STATE_RUNNING);
-    pthread_mutex_unlock(ctx->resume_mu);
 }
 
-static inline void cilk_wait(void) {
-    struct thread_context * ctx = thread_context();
+static void thread_table_clear(struct thread_table * self) {
+    size_t len = atomic_load(&self->len);
 
-    pthread_mutex_lock(ctx->pause_mu);
-    assert(*ctx->state == THREAD_STATE_RUNNING);
-    *ctx->state = THREAD_STATE_WAITING;
-    pthread_cond_signal(ctx->pause_cond);
-    pthread_mutex_unlock(ctx->pause_mu);
+    for (size_t i = 0; i < len; i++)
+        thread_drop(thread_table_get(self, i));
 
-    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
-    *SCHEDULER->wakeup = true;
-    pthread_cond_signal(&SCHEDULER->wakeup_cond);
-    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+    atomic_store(&self->len, 0);
+}
 
-    pthread_mutex_lock(ctx->resume_mu);
-    while (*ctx->state == THREAD_STATE_WAITING) {
-        pthread_cond_wait(ctx->resume_cond, ctx->resume_mu);
-    }
-    assert(*ctx->state == THREAD_STATE_JOINING);
-    pthread_mutex_unlock(ctx->resume_mu);
+static struct thread * thread_table_get(struct thread_table * self, size_t id) {
+    struct thread_directory * directory = atomic_load_explicit(&self->directory, memory_order_acquire);
 
-    // Now the thread needs to wait for the child threads to finish.
-    for (size_t i = 0; i < SCHEDULER->threads.len; i++) {
-        struct thread * t = &SCHEDULER->threads.items[i];
+    return &directory->chunks[id / THREAD_CHUNK_LEN]->items[id % THREAD_CHUNK_LEN];
+}
 
-        if (t->state == ctx->state) continue;
+/// Makes room for one more chunk. Only called with `SCHEDULER_MU` held.
+static void thread_table_grow(struct thread_table * self) {
+    struct thread_directory * directory = atomic_load_explicit(&self->directory, memory_order_relaxed);
 
-        while (*t->state != THREAD_STATE_TERMINATED) {
-        }
+    if (directory == NULL || self->chunks_len == directory->cap) {
+        size_t cap = directory == NULL ? 1 : directory->cap * 2;
+        struct thread_directory * grown = malloc(sizeof(struct thread_directory) + cap * sizeof(struct thread_chunk *));
+
+        grown->prev = directory;
+        grown->cap = cap;
+        for (size_t i = 0; i < self->chunks_len; i++)
+            grown->chunks[i] = directory->chunks[i];
+
+        directory = grown;
     }
 
-    *ctx->state = THREAD_STATE_RUNNING;
-}
+    directory->chunks[self->chunks_len] = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct thread_chunk));
+    self->chunks_len += 1;
 
-static void * run_cilk_thread(void * arg) {
-    struct run_cilk_thread_params * params = arg;
-    struct thread_context * ctx = thread_context();
+    atomic_store_explicit(&self->directory, directory, memory_order_release);
+}
 
+static struct thread * thread_table_claim(
+    struct thread_table * self,
+    size_t parent,
+    void * (* routine)(void *),
+    const void * arg
+) {
     pthread_mutex_lock(&SCHEDULER_MU);
-    thread_vec_push(&SCHEDULER->threads, (struct thread) {
-        .id = SCHEDULER->threads.len,
-        .state = ctx->state,
-        .parent = params->parent,
-        .pause_mu = ctx->pause_mu,
-        .pause_cond = ctx->pause_cond,
-        .resume_mu = ctx->resume_mu,
-        .resume_cond = ctx->resume_cond,
-    });
-    SCHEDULER->queued_spawn_batch_count += 1;
-    pthread_mutex_unlock(&SCHEDULER_MU);
 
-    // Pause
-    cilk_pause();
+    size_t id = atomic_load_explicit(&self->len, memory_order_relaxed);
+    if (id == self->chunks_len * THREAD_CHUNK_LEN)
+        thread_table_grow(self);
 
-    void * ret = (params->f)(params->arg);
+    struct thread * thread = thread_table_get(self, id);
+    thread_init(thread, id, parent, routine, arg);
 
-    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
-    *SCHEDULER->wakeup = true;
-    pthread_cond_signal(&SCHEDULER->wakeup_cond);
-    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+    // Publish the initialized slot to the scheduler scan.
+    atomic_store_explicit(&self->len, id + 1, memory_order_release);
+    pthread_mutex_unlock(&SCHEDULER_MU);
 
-    *ctx->state = THREAD_STATE_TERMINATED;
+    return thread;
+}
+
+/// Reads a decimal environment variable that is at least `min_value`, or
+/// exits if it is set to anything else.
+static size_t env_size(const char * name, size_t default_value, size_t min_value) {
+    const char * value = getenv(name);
+    if (value == NULL || *value == '\0') return default_value;
+
+    char * end;
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &end, 10);
+
+    if (*value < '0' || *value > '9' || *end != '\0' || errno != 0 || parsed < min_value) {
+        fprintf(stderr, "[cilk] Invalid %s `%s`, expected an integer of at least %zu.\n", name, value, min_value);
+        exit(1);
+    }
+
+    return parsed;
+}
+
+static void scheduler_init(struct scheduler * self) {
+    const char * strategy = getenv("CILK_STRATEGY");
+
+    if (strategy == NULL || strcmp(strategy, "random") == 0) {
+        self->strategy = STRATEGY_RANDOM;
+        self->iterations = env_size("CILK_ITERATIONS", 1, 1);
+    } else if (strcmp(strategy, "fuzz") == 0) {
+        self->strategy = STRATEGY_FUZZ;
+        self->iterations = env_size("CILK_ITERATIONS", 1000, 1);
+    } else if (strcmp(strategy, "dfs") == 0) {
+        self->strategy = STRATEGY_DFS;
+        self->iterations = env_size("CILK_ITERATIONS", SIZE_MAX, 1);
+    } else {
+        fprintf(stderr, "[cilk] Unknown strategy `%s`.\n", strategy);
+        exit(1);
+    }
+
+    const char * symmetry = getenv("CILK_SYMMETRY");
+
+    if (symmetry == NULL || strcmp(symmetry, "off") == 0) {
+        self->symmetry = SYMMETRY_OFF;
+    } else if (strcmp(symmetry, "arg") == 0) {
+        self->symmetry = SYMMETRY_ARG;
+    } else if (strcmp(symmetry, "routine") == 0) {
+        self->symmetry = SYMMETRY_ROUTINE;
+    } else {
+        fprintf(stderr, "[cilk] Unknown symmetry mode `%s`.\n", symmetry);
+        exit(1);
+    }
+
+#ifdef CILK_PRELOAD
+    // `pthread_join` and `pthread_self` tell threads apart by their handle,
+    // so threads spawned alike are never interchangeable.
+    if (self->symmetry != SYMMETRY_OFF) {
+        fprintf(stderr, "[cilk] CILK_SYMMETRY is not supported by the preload library.\n");
+        exit(1);
+    }
+#endif
+
+    if (getenv("CILK_SEED") != NULL)
+        srand(env_size("CILK_SEED", 0, 0));
+
+    execution_init(&self->replay);
+    self->replay_is_exact = true;
+
+    const char * replay_path = getenv("CILK_REPLAY");
+    if (replay_path != NULL && !execution_load(&self->replay, replay_path)) {
+        fprintf(stderr, "[cilk] Failed to load schedule from %s.\n", replay_path);
+        exit(1);
+    }
+
+    fuzzer_init(&self->fuzzer, getenv("CILK_CORPUS"));
+
+    if (self->fuzzer.corpus_dir != NULL) {
+        mkdir(self->fuzzer.corpus_dir, 0755);
+        signal(SIGABRT, on_abort);
+    }
+
+    if (self->strategy == STRATEGY_FUZZ)
+        fuzzer_load_corpus(&self->fuzzer);
+
+    explorer_init(&self->explorer);
+
+    if (self->strategy == STRATEGY_DFS) {
+        self->explorer.checkpoint_path = getenv("CILK_CHECKPOINT");
+        self->explorer.checkpoint_interval = env_size("CILK_CHECKPOINT_INTERVAL", 1000, 1);
+
+        const char * resume_path = getenv("CILK_RESUME");
+        if (resume_path != NULL) {
+            size_t shard = 0;
+            size_t shards = 1;
+
+            const char * shard_spec = getenv("CILK_SHARD");
+            if (shard_spec != NULL && (sscanf(shard_spec, "%zu/%zu", &shard, &shards) != 2 || shard >= shards)) {
+                fprintf(stderr, "[cilk] Invalid shard `%s`, expected `k/n` with k < n.\n", shard_spec);
+                exit(1);
+            }
+
+            if (!explorer_load(&self->explorer, resume_path, shard, shards)) {
+                fprintf(stderr, "[cilk] Failed to load checkpoint from %s.\n", resume_path);
+                exit(1);
+            }
+
+            fprintf(stderr, "[cilk] Resuming %zu unexplored branch(es).\n", explorer_pending(&self->explorer));
+        }
+    }
+
+    thread_table_init(&self->threads);
+    self->execution = NULL;
+    self->executions_len = 0;
+    queued_spawn_vec_init(&self->queued_spawns);
+    self->candidates = NULL;
+    self->candidates_cap = 0;
+    sync_mutex_vec_init(&self->mutexes);
+
+    self->pthreads = NULL;
+    self->pthreads_len = 0;
+    self->wakeup = malloc(sizeof(bool));
+    *self->wakeup = false;
+
+    pthread_cond_init(&self->wakeup_cond, NULL);
+    pthread_mutex_init(&self->wakeup_mu, NULL);
+}
+
+static void scheduler_drop(struct scheduler * self) {
+    pthread_cond_destroy(&self->wakeup_cond);
+    pthread_mutex_destroy(&self->wakeup_mu);
+    free(self->wakeup);
+    free(self->pthreads);
+
+    free(self->candidates);
+    sync_mutex_vec_drop(&self->mutexes);
+    queued_spawn_vec_drop(&self->queued_spawns);
+    thread_table_drop(&self->threads);
+
+    explorer_drop(&self->explorer);
+    fuzzer_drop(&self->fuzzer);
+    execution_drop(&self->replay);
+}
+
+static void scheduler_execution_start(struct scheduler * self) {
+    thread_table_clear(&self->threads);
+    self->mutexes.len = 0;
+    self->pthreads_len = 0;
+    *self->wakeup = false;
+#ifdef CILK_PRELOAD
+    self->main_exited = false;
+#endif
+
+    self->replay_is_exact = true;
+
+    // Corpus entries may predate a change to the program, and mutants
+    // diverge by design; either way the fuzzer keeps going.
+    if (self->strategy == STRATEGY_FUZZ && self->replay.decision_points.len == 0) {
+        fuzzer_mutate(&self->fuzzer, &self->replay);
+        self->replay_is_exact = false;
+    }
+
+    if (self->strategy == STRATEGY_DFS) {
+        self->replay.decision_points.len = 0;
+        decision_point_vec_clone(&self->replay.decision_points, &self->explorer.next.decision_points);
+    }
+
+    self->execution = malloc(sizeof(struct execution));
+    execution_init(self->execution);
+}
+
+static void scheduler_execution_stop(struct scheduler * self) {
+    if (self->strategy == STRATEGY_FUZZ)
+        fuzzer_feedback(&self->fuzzer, self->execution);
+
+    if (self->strategy == STRATEGY_DFS)
+        explorer_advance(&self->explorer, self->execution);
+
+    execution_drop(&self->replay);
+    execution_init(&self->replay);
+
+    execution_drop(self->execution);
+    free(self->execution);
+    self->execution = NULL;
+    self->executions_len += 1;
+
+    struct explorer * explorer = &self->explorer;
+
+    if (explorer->checkpoint_path != NULL) {
+        bool is_due = self->executions_len % explorer->checkpoint_interval == 0;
+
+        if ((is_due || scheduler_is_exhausted(self)) && !explorer_save(explorer))
+            fprintf(stderr, "[cilk] Failed to write checkpoint to %s.\n", explorer->checkpoint_path);
+    }
+}
+
+static bool scheduler_is_exhausted(struct scheduler * self) {
+    if (self->strategy == STRATEGY_DFS && self->explorer.is_exhausted) return true;
+
+    return self->executions_len >= self->iterations;
+}
+
+/// Replays the recorded choice while there is one, then takes the first
+/// choice when exploring and picks at random otherwise.
+static size_t scheduler_choose(struct scheduler * self, size_t num_choices) {
+    size_t i = self->execution->decision_points.len;
+
+    if (i < self->replay.decision_points.len) {
+        const struct decision_point * point = &self->replay.decision_points.items[i];
+
+        if (self->replay_is_exact && point->num_choices != num_choices) {
+            // The program is not deterministic under this schedule, or the
+            // schedule belongs to another program; either way the replay no
+            // longer means anything. `_exit` keeps a preload execution from
+            // reporting it as a failure of the program.
+            fprintf(
+                stderr,
+                "[cilk] Replay diverged at decision point %zu: recorded %zu choice(s), found %zu.\n",
+                i, point->num_choices, num_choices
+            );
+            _exit(1);
+        }
+
+        return point->choice % num_choices;
+    }
+
+    if (self->strategy == STRATEGY_DFS) return 0;
+
+    return rand() % num_choices;
+}
+
+/// Chooses like `scheduler_choose` and records the decision point in the
+/// current execution.
+static size_t scheduler_decide(struct scheduler * self, size_t num_choices) {
+    size_t choice = scheduler_choose(self, num_choices);
+
+    fprintf(stderr, "[cilk] Decision point with %zu choice(s). Picking idx %zu.\n", num_choices, choice);
+    decision_point_vec_push(&self->execution->decision_points, (struct decision_point){
+        .num_choices = num_choices,
+        .choice = choice,
+    });
+
+    return choice;
+}
+
+static bool scheduler_thread_is_enabled(struct scheduler * self, const struct thread * thread) {
+    switch (thread->block) {
+    case THREAD_BLOCK_NONE:
+        return true;
+    case THREAD_BLOCK_JOIN: {
+        const struct thread * target = thread->blocked_on;
+
+        return atomic_load(&target->state) == THREAD_STATE_TERMINATED;
+    }
+    case THREAD_BLOCK_MUTEX:
+        return !sync_mutex_vec_get(&self->mutexes, thread->blocked_on)->locked;
+    case THREAD_BLOCK_COND:
+        return false;
+    case THREAD_BLOCK_COND_TIMED:
+        return !sync_mutex_vec_get(&self->mutexes, thread->cond_mutex)->locked;
+    }
+
+    return true;
+}
+
+/// Saves a failing schedule as `crash-*` in the corpus directory, if any.
+static void scheduler_save_failure(struct scheduler * self, const struct execution * execution) {
+    if (self->fuzzer.corpus_dir == NULL) return;
+
+    char path[4096];
+    snprintf(
+        path, sizeof(path), "%s/crash-%016llx",
+        self->fuzzer.corpus_dir, (unsigned long long) execution_hash(execution)
+    );
+
+    if (execution_save(execution, path))
+        fprintf(stderr, "[cilk] Failing schedule saved to %s.\n", path);
+}
+
+static void on_abort(int sig) {
+    // The failing thread is the only one running, so the current execution
+    // is not being modified concurrently.
+    if (SCHEDULER != NULL && SCHEDULER->execution != NULL)
+        scheduler_save_failure(SCHEDULER, SCHEDULER->execution);
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void * run_scheduler(void * arg) {
+    struct thread_table * table = &SCHEDULER->threads;
+
+    while (true) {
+        pthread_mutex_lock(&SCHEDULER->wakeup_mu);
+        while (!*SCHEDULER->wakeup)
+            pthread_cond_wait(&SCHEDULER->wakeup_cond, &SCHEDULER->wakeup_mu);
+        *SCHEDULER->wakeup = false;
+        pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+
+        size_t threads_len = atomic_load_explicit(&SCHEDULER->threads.len, memory_order_acquire);
+
+        for (size_t i = 0; i < threads_len; i++) {
+            struct thread * thread = thread_table_get(table, i);
+
+            if (atomic_load(&thread->state) != THREAD_STATE_RUNNING) continue;
+
+            pthread_mutex_lock(&thread->pause_mu);
+            while (atomic_load(&thread->state) == THREAD_STATE_RUNNING) {
+                pthread_cond_wait(&thread->pause_cond, &thread->pause_mu);
+            }
+            pthread_mutex_unlock(&thread->pause_mu);
+        }
+
+        // Now all threads are not running.
+        bool all_threads_terminated = true;
+        for (size_t i = 0; i < threads_len; i++) {
+            if (atomic_load(&thread_table_get(table, i)->state) != THREAD_STATE_TERMINATED) {
+                all_threads_terminated = false;
+                break;
+            }
+        }
+
+        if (all_threads_terminated) break;
+
+#ifdef CILK_PRELOAD
+        // Returning from `main` ends the process, whatever the other threads
+        // are blocked on.
+        if (atomic_load(&thread_table_get(table, 0)->state) == THREAD_STATE_TERMINATED && !SCHEDULER->main_exited) break;
+#endif
+
+        bool new_spawns = false;
+
+        // Check if any parent thread is waiting (joining) or forking.
+        // If so, we need to spawn the threads.
+        for (size_t i = 0; i < threads_len; i++) {
+            struct thread * t = thread_table_get(table, i);
+            enum thread_state state = atomic_load(&t->state);
+
+            if (state == THREAD_STATE_WAITING || state == THREAD_STATE_FORKING) {
+                struct queued_spawn spawn;
+
+                while (queued_spawn_vec_pop(&SCHEDULER->queued_spawns, &spawn)) {
+                    // Dispatch the queued spawn.
+
+                    fprintf(stderr, "[cilk] Spawning queued thread...\n");
+
+                    struct run_cilk_thread_params * params = malloc(sizeof(struct run_cilk_thread_params));
+
+                    // The slot is claimed here rather than by the new thread
+                    // so that it is visible to the next scan, which then
+                    // waits for the child to reach its first pause.
+                    *params = (struct run_cilk_thread_params) {
+                        .f = spawn.f,
+                        .arg = spawn.arg,
+                        .thread = thread_table_claim(&SCHEDULER->threads, t->id, spawn.f, spawn.arg),
+                    };
+
+                    pthread_t pthread;
+
+                    int err = pthread_create(&pthread, NULL, run_cilk_thread, params);
+                    if (err) {
+                        fprintf(stderr, "[cilk] Failed to spawn queued thread.\n");
+                        exit(1);
+                    }
+
+                    SCHEDULER->pthreads_len += 1;
+                    SCHEDULER->pthreads = realloc(SCHEDULER->pthreads, SCHEDULER->pthreads_len * sizeof(pthread_t));
+                    SCHEDULER->pthreads[SCHEDULER->pthreads_len - 1] = pthread;
+
+                    params->thread->pthread = pthread;
+                    t->forked = params->thread;
+
+                    new_spawns = true;
+                }
+
+                // Resume the waiting parent thread. A forking parent carries
+                // on running alongside its child until both pause.
+                pthread_mutex_lock(&t->resume_mu);
+                atomic_store(&t->state, state == THREAD_STATE_WAITING ? THREAD_STATE_JOINING : THREAD_STATE_RUNNING);
+                pthread_cond_signal(&t->resume_cond);
+                pthread_mutex_unlock(&t->resume_mu);
+            }
+        }
+
+        if (new_spawns) continue;
+
+        if (SCHEDULER->candidates_cap < threads_len) {
+            SCHEDULER->candidates_cap = threads_len;
+            SCHEDULER->candidates = realloc(SCHEDULER->candidates, threads_len * sizeof(size_t));
+        }
+
+        size_t * candidates = SCHEDULER->candidates;
+        size_t candidates_len = 0;
+
+        for (size_t i = 0; i < threads_len; i++) {
+            struct thread * thread = thread_table_get(table, i);
+
+            if (atomic_load(&thread->state) != THREAD_STATE_PAUSED) continue;
+            if (!scheduler_thread_is_enabled(SCHEDULER, thread)) continue;
+
+            // Only the lowest-id thread of each symmetric group is a
+            // candidate; resuming any other member leads to an equivalent
+            // schedule.
+            bool is_redundant = false;
+            for (size_t j = 0; j < candidates_len; j++) {
+                if (thread_is_symmetric(thread_table_get(table, candidates[j]), thread, SCHEDULER->symmetry)) {
+                    is_redundant = true;
+                    break;
+                }
+            }
+
+            if (is_redundant) continue;
+
+            candidates[candidates_len] = i;
+            candidates_len += 1;
+        }
+
+        if (candidates_len == 0) {
+            // Joining threads make progress on their own and may have
+            // resumed running since the scan; otherwise every live thread
+            // is blocked.
+            bool is_deadlock = true;
+            for (size_t i = 0; i < threads_len; i++) {
+                enum thread_state state = atomic_load(&thread_table_get(table, i)->state);
+
+                if (state == THREAD_STATE_JOINING || state == THREAD_STATE_RUNNING) {
+                    is_deadlock = false;
+                    break;
+                }
+            }
+
+            if (is_deadlock) {
+                fprintf(stderr, "[cilk] Deadlock: every live thread is blocked.\n");
+                abort();
+            }
+
+            continue;
+        }
+
+        size_t choice = scheduler_decide(SCHEDULER, candidates_len);
+
+
+        // Unpause a thread.
+
+        struct thread * thread = thread_table_get(table, candidates[choice]);
+        thread->steps += 1;
+
+        if (SCHEDULER->strategy == STRATEGY_FUZZ)
+            fuzzer_cover(&SCHEDULER->fuzzer, thread->id, thread->pc);
+
+        pthread_mutex_lock(&thread->resume_mu);
+        atomic_store(&thread->state, THREAD_STATE_RUNNING);
+        pthread_cond_signal(&thread->resume_cond);
+        pthread_mutex_unlock(&thread->resume_mu);
+    }
+
+    return NULL;
+}
+
+static void thread_terminate(struct thread * self) {
+    pthread_mutex_lock(&self->pause_mu);
+    atomic_store(&self->state, THREAD_STATE_TERMINATED);
+    pthread_cond_signal(&self->pause_cond);
+    pthread_mutex_unlock(&self->pause_mu);
+
+    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
+    *SCHEDULER->wakeup = true;
+    pthread_cond_signal(&SCHEDULER->wakeup_cond);
+    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+}
+
+static void run_execution(void (* f)(void *), void * arg) {
+    pthread_t scheduler_pthread;
+
+    int err = pthread_create(&scheduler_pthread, NULL, run_scheduler, NULL);
+    if (err) {
+        fprintf(stderr, "[cilk] Failed to spawn scheduler thread.\n");
+        exit(1);
+    }
+
+    execute(f, arg);
+
+#ifndef CILK_PRELOAD
+    for (size_t i = 0; i < SCHEDULER->pthreads_len; i++) {
+        pthread_join(SCHEDULER->pthreads[i], NULL);
+    }
+#endif
+
+    // In preload mode threads left behind by `main` may never finish; the
+    // forked process exits around them instead.
+    pthread_join(scheduler_pthread, NULL);
+}
+
+static void execute(void (* f)(void *), void * arg) {
+    // The main thread is never symmetric to another, so it needs no routine.
+    CTX = thread_table_claim(&SCHEDULER->threads, 0, NULL, arg);
+
+    (f)(arg);
+
+    thread_terminate(CTX);
+    CTX = NULL;
+}
+
+static inline void cilk_pause(uintptr_t pc) {
+    struct thread * ctx = CTX;
+
+    ctx->pc = pc;
+
+    pthread_mutex_lock(&ctx->pause_mu);
+    assert(atomic_load(&ctx->state) == THREAD_STATE_RUNNING);
+    atomic_store(&ctx->state, THREAD_STATE_PAUSED);
+    pthread_cond_signal(&ctx->pause_cond);
+    pthread_mutex_unlock(&ctx->pause_mu);
+
+    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
+    *SCHEDULER->wakeup = true;
+    pthread_cond_signal(&SCHEDULER->wakeup_cond);
+    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+
+    pthread_mutex_lock(&ctx->resume_mu);
+    while (atomic_load(&ctx->state) == THREAD_STATE_PAUSED) {
+        pthread_cond_wait(&ctx->resume_cond, &ctx->resume_mu);
+    }
+    assert(atomic_load(&ctx->state) == THREAD_STATE_RUNNING);
+    pthread_mutex_unlock(&ctx->resume_mu);
+}
+
+static inline void cilk_wait(uintptr_t pc) {
+    struct thread * ctx = CTX;
+
+    ctx->pc = pc;
+
+    pthread_mutex_lock(&ctx->pause_mu);
+    assert(atomic_load(&ctx->state) == THREAD_STATE_RUNNING);
+    atomic_store(&ctx->state, THREAD_STATE_WAITING);
+    pthread_cond_signal(&ctx->pause_cond);
+    pthread_mutex_unlock(&ctx->pause_mu);
+
+    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
+    *SCHEDULER->wakeup = true;
+    pthread_cond_signal(&SCHEDULER->wakeup_cond);
+    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+
+    pthread_mutex_lock(&ctx->resume_mu);
+    while (atomic_load(&ctx->state) == THREAD_STATE_WAITING) {
+        pthread_cond_wait(&ctx->resume_cond, &ctx->resume_mu);
+    }
+    assert(atomic_load(&ctx->state) == THREAD_STATE_JOINING);
+    pthread_mutex_unlock(&ctx->resume_mu);
+
+    // Now the thread needs to wait for the child threads to finish.
+    struct thread_table * table = &SCHEDULER->threads;
+    size_t threads_len = atomic_load_explicit(&SCHEDULER->threads.len, memory_order_acquire);
+
+    for (size_t i = 0; i < threads_len; i++) {
+        struct thread * t = thread_table_get(table, i);
+
+        if (t == ctx) continue;
+
+        while (atomic_load(&t->state) != THREAD_STATE_TERMINATED) {
+        }
+    }
+
+    atomic_store(&ctx->state, THREAD_STATE_RUNNING);
+}
+
+static void * run_cilk_thread(void * arg) {
+    struct run_cilk_thread_params * params = arg;
+
+    CTX = params->thread;
+
+    // Pause
+    cilk_pause((uintptr_t) params->f);
+
+    void * ret = (params->f)(params->arg);
+
+    CTX->ret = ret;
+    thread_terminate(CTX);
+    CTX = NULL;
+    free(params);
 
     return ret;
 }
+
+#ifdef CILK_PRELOAD
+
+// Built into `libcilk-preload.so`: runs an unmodified pthread program's
+// `main` under `cilk_model` and routes its threads and synchronisation into
+// the scheduler.
+
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+static struct thread * cilk_fork(void * (* f)(void *), void * arg, uintptr_t pc) {
+    struct thread * ctx = CTX;
+
+    cilk_pause(pc);
+
+    struct queued_spawn spawn;
+    queued_spawn_init(&spawn, f, arg);
+    queued_spawn_vec_push(&SCHEDULER->queued_spawns, spawn);
+
+    pthread_mutex_lock(&ctx->pause_mu);
+    atomic_store(&ctx->state, THREAD_STATE_FORKING);
+    pthread_cond_signal(&ctx->pause_cond);
+    pthread_mutex_unlock(&ctx->pause_mu);
+
+    pthread_mutex_lock(&SCHEDULER->wakeup_mu);
+    *SCHEDULER->wakeup = true;
+    pthread_cond_signal(&SCHEDULER->wakeup_cond);
+    pthread_mutex_unlock(&SCHEDULER->wakeup_mu);
+
+    pthread_mutex_lock(&ctx->resume_mu);
+    while (atomic_load(&ctx->state) == THREAD_STATE_FORKING) {
+        pthread_cond_wait(&ctx->resume_cond, &ctx->resume_mu);
+    }
+    assert(atomic_load(&ctx->state) == THREAD_STATE_RUNNING);
+    pthread_mutex_unlock(&ctx->resume_mu);
+
+    return ctx->forked;
+}
+
+static void cilk_mutex_acquire(struct thread * ctx, const void * mutex) {
+    struct sync_mutex * m = sync_mutex_vec_get(&SCHEDULER->mutexes, mutex);
+
+    assert(!m->locked);
+    m->locked = true;
+    m->owner = ctx->id;
+
+    if (SCHEDULER->strategy == STRATEGY_FUZZ)
+        fuzzer_cover_lock_order(&SCHEDULER->fuzzer, ctx->last_mutex, mutex);
+
+    ctx->last_mutex = mutex;
+}
+
+static int cilk_cond_wait(const void * cond, const void * mutex, bool timed, uintptr_t pc) {
+    struct thread * ctx = CTX;
+    struct sync_mutex * m = sync_mutex_vec_get(&SCHEDULER->mutexes, mutex);
+
+    if (!m->locked || m->owner != ctx->id) return EPERM;
+
+    m->locked = false;
+
+    ctx->block = timed ? THREAD_BLOCK_COND_TIMED : THREAD_BLOCK_COND;
+    ctx->blocked_on = cond;
+    ctx->cond_mutex = mutex;
+    cilk_pause(pc);
+
+    // A timed wait that is resumed without having been signalled timed out.
+    bool timed_out = ctx->block == THREAD_BLOCK_COND_TIMED;
+    ctx->block = THREAD_BLOCK_NONE;
+
+    cilk_mutex_acquire(ctx, mutex);
+
+    return timed_out ? ETIMEDOUT : 0;
+}
+
+static bool cilk_cond_is_waiter(const struct thread * thread, const void * cond) {
+    if (thread->block != THREAD_BLOCK_COND && thread->block != THREAD_BLOCK_COND_TIMED) return false;
+
+    return thread->blocked_on == cond;
+}
+
+/// Wakes one waiter on `cond`, or all of them. POSIX leaves open which one a
+/// signal wakes, so that is a decision point of its own. Woken threads then
+/// wait for the mutex they released.
+static void cilk_cond_notify(const void * cond, bool all) {
+    struct thread_table * table = &SCHEDULER->threads;
+    size_t threads_len = atomic_load_explicit(&SCHEDULER->threads.len, memory_order_acquire);
+
+    size_t waiters = 0;
+    for (size_t i = 0; i < threads_len; i++) {
+        if (cilk_cond_is_waiter(thread_table_get(table, i), cond)) waiters += 1;
+    }
+
+    // The signalling thread is the only one running, so it may decide in the
+    // scheduler's place.
+    size_t woken = all || waiters < 2 ? 0 : scheduler_decide(SCHEDULER, waiters);
+
+    for (size_t i = 0, waiter = 0; i < threads_len; i++) {
+        struct thread * t = thread_table_get(table, i);
+
+        if (!cilk_cond_is_waiter(t, cond)) continue;
+
+        if (all || waiter == woken) {
+            t->block = THREAD_BLOCK_MUTEX;
+            t->blocked_on = t->cond_mutex;
+        }
+
+        waiter += 1;
+    }
+}
+
+#undef pthread_create
+#undef pthread_join
+#undef pthread_exit
+#undef pthread_mutex_init
+#undef pthread_mutex_destroy
+#undef pthread_mutex_lock
+#undef pthread_mutex_trylock
+#undef pthread_mutex_unlock
+#undef pthread_cond_init
+#undef pthread_cond_destroy
+#undef pthread_cond_wait
+#undef pthread_cond_timedwait
+#undef pthread_cond_signal
+#undef pthread_cond_broadcast
+#undef usleep
+
+/// Resolves libc's definition of `name` into `real`.
+#define CILK_REAL(name) \
+    static __typeof__(cilk_real_##name) * real = NULL; \
+    if (real == NULL) *(void **) &real = dlsym(RTLD_NEXT, #name)
+
+int cilk_real_pthread_create(
+    pthread_t * thread,
+    const pthread_attr_t * attr,
+    void * (* start_routine)(void *),
+    void * arg
+) {
+    CILK_REAL(pthread_create);
+    return real(thread, attr, start_routine, arg);
+}
+
+int cilk_real_pthread_join(pthread_t thread, void ** ret) {
+    CILK_REAL(pthread_join);
+    return real(thread, ret);
+}
+
+void cilk_real_pthread_exit(void * ret) {
+    CILK_REAL(pthread_exit);
+    real(ret);
+    __builtin_unreachable();
+}
+
+int cilk_real_pthread_mutex_init(pthread_mutex_t * mutex, const pthread_mutexattr_t * attr) {
+    CILK_REAL(pthread_mutex_init);
+    return real(mutex, attr);
+}
+
+int cilk_real_pthread_mutex_destroy(pthread_mutex_t * mutex) {
+    CILK_REAL(pthread_mutex_destroy);
+    return real(mutex);
+}
+
+int cilk_real_pthread_mutex_lock(pthread_mutex_t * mutex) {
+    CILK_REAL(pthread_mutex_lock);
+    return real(mutex);
+}
+
+int cilk_real_pthread_mutex_trylock(pthread_mutex_t * mutex) {
+    CILK_REAL(pthread_mutex_trylock);
+    return real(mutex);
+}
+
+int cilk_real_pthread_mutex_unlock(pthread_mutex_t * mutex) {
+    CILK_REAL(pthread_mutex_unlock);
+    return real(mutex);
+}
+
+int cilk_real_pthread_cond_init(pthread_cond_t * cond, const pthread_condattr_t * attr) {
+    CILK_REAL(pthread_cond_init);
+    return real(cond, attr);
+}
+
+int cilk_real_pthread_cond_destroy(pthread_cond_t * cond) {
+    CILK_REAL(pthread_cond_destroy);
+    return real(cond);
+}
+
+int cilk_real_pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex) {
+    CILK_REAL(pthread_cond_wait);
+    return real(cond, mutex);
+}
+
+int cilk_real_pthread_cond_timedwait(
+    pthread_cond_t * cond,
+    pthread_mutex_t * mutex,
+    const struct timespec * abstime
+) {
+    CILK_REAL(pthread_cond_timedwait);
+    return real(cond, mutex, abstime);
+}
+
+int cilk_real_pthread_cond_signal(pthread_cond_t * cond) {
+    CILK_REAL(pthread_cond_signal);
+    return real(cond);
+}
+
+int cilk_real_pthread_cond_broadcast(pthread_cond_t * cond) {
+    CILK_REAL(pthread_cond_broadcast);
+    return real(cond);
+}
+
+int cilk_real_usleep(useconds_t usec) {
+    CILK_REAL(usleep);
+    return real(usec);
+}
+
+int pthread_create(
+    pthread_t * thread,
+    const pthread_attr_t * attr,
+    void * (* start_routine)(void *),
+    void * arg
+) {
+    if (CTX == NULL) return cilk_real_pthread_create(thread, attr, start_routine, arg);
+
+    *thread = cilk_fork(start_routine, arg, (uintptr_t) __builtin_return_address(0))->pthread;
+
+    return 0;
+}
+
+int pthread_join(pthread_t thread, void ** ret) {
+    struct thread * ctx = CTX;
+    if (ctx == NULL) return cilk_real_pthread_join(thread, ret);
+
+    // The main thread has no pthread of its own in the table.
+    struct thread_table * table = &SCHEDULER->threads;
+    size_t threads_len = atomic_load_explicit(&SCHEDULER->threads.len, memory_order_acquire);
+    struct thread * target = NULL;
+
+    for (size_t i = 1; i < threads_len; i++) {
+        struct thread * t = thread_table_get(table, i);
+
+        if (pthread_equal(t->pthread, thread)) {
+            target = t;
+            break;
+        }
+    }
+
+    if (target == NULL) return ESRCH;
+    if (target == ctx) return EDEADLK;
+
+    ctx->block = THREAD_BLOCK_JOIN;
+    ctx->blocked_on = target;
+    cilk_pause((uintptr_t) __builtin_return_address(0));
+    ctx->block = THREAD_BLOCK_NONE;
+
+    if (ret != NULL) *ret = target->ret;
+
+    return 0;
+}
+
+void pthread_exit(void * ret) {
+    struct thread * ctx = CTX;
+
+    if (ctx != NULL) {
+        // The real main thread goes away too; the last thread to end calls
+        // `exit`, which reports the execution as usual.
+        if (ctx->id == 0) SCHEDULER->main_exited = true;
+
+        ctx->ret = ret;
+        thread_terminate(ctx);
+        CTX = NULL;
+    }
+
+    cilk_real_pthread_exit(ret);
+}
+
+int pthread_mutex_init(pthread_mutex_t * mutex, const pthread_mutexattr_t * attr) {
+    if (CTX != NULL) sync_mutex_vec_get(&SCHEDULER->mutexes, mutex)->locked = false;
+
+    return cilk_real_pthread_mutex_init(mutex, attr);
+}
+
+int pthread_mutex_destroy(pthread_mutex_t * mutex) {
+    return cilk_real_pthread_mutex_destroy(mutex);
+}
+
+int pthread_mutex_lock(pthread_mutex_t * mutex) {
+    struct thread * ctx = CTX;
+    if (ctx == NULL) return cilk_real_pthread_mutex_lock(mutex);
+
+    ctx->block = THREAD_BLOCK_MUTEX;
+    ctx->blocked_on = mutex;
+    cilk_pause((uintptr_t) __builtin_return_address(0));
+    ctx->block = THREAD_BLOCK_NONE;
+
+    cilk_mutex_acquire(ctx, mutex);
+
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t * mutex) {
+    struct thread * ctx = CTX;
+    if (ctx == NULL) return cilk_real_pthread_mutex_trylock(mutex);
+
+    cilk_pause((uintptr_t) __builtin_return_address(0));
+
+    if (sync_mutex_vec_get(&SCHEDULER->mutexes, mutex)->locked) return EBUSY;
+
+    cilk_mutex_acquire(ctx, mutex);
+
+    return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t * mutex) {
+    struct thread * ctx = CTX;
+    if (ctx == NULL) return cilk_real_pthread_mutex_unlock(mutex);
+
+    struct sync_mutex * m = sync_mutex_vec_get(&SCHEDULER->mutexes, mutex);
+    if (!m->locked || m->owner != ctx->id) return EPERM;
+
+    m->locked = false;
+
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t * cond, const pthread_condattr_t * attr) {
+    return cilk_real_pthread_cond_init(cond, attr);
+}
+
+int pthread_cond_destroy(pthread_cond_t * cond) {
+    return cilk_real_pthread_cond_destroy(cond);
+}
+
+int pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex) {
+    if (CTX == NULL) return cilk_real_pthread_cond_wait(cond, mutex);
+
+    return cilk_cond_wait(cond, mutex, false, (uintptr_t) __builtin_return_address(0));
+}
+
+int pthread_cond_timedwait(pthread_cond_t * cond, pthread_mutex_t * mutex, const struct timespec * abstime) {
+    if (CTX == NULL) return cilk_real_pthread_cond_timedwait(cond, mutex, abstime);
+
+    return cilk_cond_wait(cond, mutex, true, (uintptr_t) __builtin_return_address(0));
+}
+
+int pthread_cond_signal(pthread_cond_t * cond) {
+    if (CTX == NULL) return cilk_real_pthread_cond_signal(cond);
+
+    cilk_cond_notify(cond, false);
+
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t * cond) {
+    if (CTX == NULL) return cilk_real_pthread_cond_broadcast(cond);
+
+    cilk_cond_notify(cond, true);
+
+    return 0;
+}
+
+int usleep(useconds_t usec) {
+    if (CTX == NULL) return cilk_real_usleep(usec);
+
+    cilk_pause((uintptr_t) __builtin_return_address(0));
+
+    return 0;
+}
+
+typedef int (* main_fn)(int, char **, char **);
+
+typedef int (* libc_start_main_fn)(
+    main_fn main,
+    int argc,
+    char ** argv,
+    void (* init)(void),
+    void (* fini)(void),
+    void (* rtld_fini)(void),
+    void * stack_end
+);
+
+static main_fn MAIN = NULL;
+static int MAIN_ARGC = 0;
+static char ** MAIN_ARGV = NULL;
+static char ** MAIN_ENVP = NULL;
+static int MAIN_STATUS = 0;
+
+static void run_main(void * arg) {
+    MAIN_STATUS = MAIN(MAIN_ARGC, MAIN_ARGV, MAIN_ENVP);
+}
+
+/// Write end of the pipe a forked execution reports back on.
+static int RESULT_FD = -1;
+
+static bool write_all(int fd, const void * buf, size_t len) {
+    const char * cursor = buf;
+
+    while (len > 0) {
+        ssize_t written = write(fd, cursor, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+
+        cursor += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+static bool read_all(int fd, void * buf, size_t len) {
+    char * cursor = buf;
+
+    while (len > 0) {
+        ssize_t got = read(fd, cursor, len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+
+        cursor += got;
+        len -= got;
+    }
+
+    return true;
+}
+
+/// Sends the execution's decision points, and the coverage map when fuzzing,
+/// to the parent. Registered with `atexit` in the child so that it also runs
+/// when the program calls `exit` itself.
+static void send_execution(void) {
+    if (SCHEDULER->execution == NULL) return;
+
+    const struct decision_point_vec * points = &SCHEDULER->execution->decision_points;
+    const struct fuzzer * fuzzer = &SCHEDULER->fuzzer;
+
+    bool ok = write_all(RESULT_FD, &points->len, sizeof(size_t))
+        && write_all(RESULT_FD, points->items, points->len * sizeof(struct decision_point));
+
+    if (ok && SCHEDULER->strategy == STRATEGY_FUZZ) {
+        ok = write_all(RESULT_FD, &fuzzer->new_coverage, sizeof(bool))
+            && write_all(RESULT_FD, fuzzer->coverage, COVERAGE_MAP_SIZE);
+    }
+
+    if (!ok) fprintf(stderr, "[cilk] Failed to report the execution.\n");
+
+    close(RESULT_FD);
+}
+
+static bool receive_execution(int fd) {
+    struct decision_point_vec * points = &SCHEDULER->execution->decision_points;
+    struct fuzzer * fuzzer = &SCHEDULER->fuzzer;
+
+    size_t len;
+    if (!read_all(fd, &len, sizeof(size_t))) return false;
+
+    for (size_t i = 0; i < len; i++) {
+        struct decision_point point;
+        if (!read_all(fd, &point, sizeof(struct decision_point))) return false;
+
+        decision_point_vec_push(points, point);
+    }
+
+    if (SCHEDULER->strategy == STRATEGY_FUZZ) {
+        return read_all(fd, &fuzzer->new_coverage, sizeof(bool))
+            && read_all(fd, fuzzer->coverage, COVERAGE_MAP_SIZE);
+    }
+
+    return true;
+}
+
+static void run_execution_forked(void (* f)(void *), void * arg) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "[cilk] Failed to create execution pipe.\n");
+        exit(1);
+    }
+
+    // A child's choices would otherwise all start from the same copy of the
+    // parent's generator, which only the parent can advance.
+    unsigned int seed = rand();
+
+    // Nothing buffered so far may be written twice.
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "[cilk] Failed to fork execution.\n");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        RESULT_FD = fds[1];
+        atexit(send_execution);
+        srand(seed);
+
+        run_execution(f, arg);
+        exit(MAIN_STATUS);
+    }
+
+    close(fds[1]);
+    bool has_result = receive_execution(fds[0]);
+    close(fds[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    if (WIFSIGNALED(status)) {
+        // The child saved its failing schedule itself, see `on_abort`.
+        int sig = WTERMSIG(status);
+
+        fprintf(stderr, "[cilk] Execution killed by signal %d.\n", sig);
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    if (!has_result) {
+        fprintf(stderr, "[cilk] Execution exited without reporting its schedule.\n");
+        exit(1);
+    }
+
+    // A failing status ends the run, as it would have ended the program.
+    if (WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "[cilk] Execution exited with status %d.\n", WEXITSTATUS(status));
+        scheduler_save_failure(SCHEDULER, SCHEDULER->execution);
+        exit(WEXITSTATUS(status));
+    }
+}
+
+static int cilk_main(int argc, char ** argv, char ** envp) {
+    MAIN_ARGC = argc;
+    MAIN_ARGV = argv;
+    MAIN_ENVP = envp;
+
+    cilk_model(run_main, NULL);
+
+    return 0;
+}
+
+int __libc_start_main(
+    main_fn main,
+    int argc,
+    char ** argv,
+    void (* init)(void),
+    void (* fini)(void),
+    void (* rtld_fini)(void),
+    void * stack_end
+) {
+    libc_start_main_fn real;
+    *(void **) &real = dlsym(RTLD_NEXT, "__libc_start_main");
+
+    MAIN = main;
+
+    return real(cilk_main, argc, argv, init, fini, rtld_fini, stack_end);
+}
+
+#endif
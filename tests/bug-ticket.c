@@ -0,0 +1,39 @@
+#include <assert.h>
+
+#include "cilk.h"
+
+static int ticket = 0;
+static int order[2];
+static int pos = 0;
+
+// Both workers are spawned alike, but once one has drawn a ticket they are no
+// longer interchangeable: the bug needs the second ticket to be handed in
+// first.
+static void * worker(void * arg) {
+    int my = ticket++;
+
+    cilk_usleep(1);
+
+    order[pos++] = my;
+
+    return NULL;
+}
+
+static void func(void * arg) {
+    struct cilk_thread a;
+    struct cilk_thread b;
+
+    ticket = 0;
+    pos = 0;
+
+    cilk_spawn(&a, worker, NULL);
+    cilk_spawn(&b, worker, NULL);
+    cilk_join(a, NULL);
+    cilk_join(b, NULL);
+
+    assert(order[0] == 0);
+}
+
+int main(void) {
+    cilk_model(func, NULL);
+}
@@ -0,0 +1,48 @@
+#include <assert.h>
+#include <pthread.h>
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t go = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+
+static int waiting = 0;
+static int signalled = 0;
+static int woken = -1;
+
+static int ids[2] = { 0, 1 };
+
+// POSIX lets a signal wake either waiter; the bug assumes it is the first.
+static void * worker(void * arg) {
+    pthread_mutex_lock(&mu);
+    waiting += 1;
+    pthread_cond_signal(&ready);
+    while (!signalled)
+        pthread_cond_wait(&go, &mu);
+    signalled = 0;
+    woken = * (int *) arg;
+    pthread_cond_signal(&done);
+    pthread_mutex_unlock(&mu);
+
+    return NULL;
+}
+
+int main(void) {
+    pthread_t workers[2];
+
+    pthread_create(&workers[0], NULL, worker, &ids[0]);
+    pthread_create(&workers[1], NULL, worker, &ids[1]);
+
+    pthread_mutex_lock(&mu);
+    while (waiting < 2)
+        pthread_cond_wait(&ready, &mu);
+    signalled = 1;
+    pthread_cond_signal(&go);
+    while (woken < 0)
+        pthread_cond_wait(&done, &mu);
+    pthread_mutex_unlock(&mu);
+
+    assert(woken == 0);
+
+    return 0;
+}
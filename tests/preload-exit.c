@@ -0,0 +1,30 @@
+#include <assert.h>
+#include <pthread.h>
+
+static int one = 1;
+static int last = 0;
+
+static void * exit_early(void * arg) {
+    pthread_exit(arg);
+
+    return NULL;
+}
+
+// Outlives `main`, which leaves through `pthread_exit`.
+static void * outlive_main(void * arg) {
+    last = 1;
+
+    return NULL;
+}
+
+int main(void) {
+    pthread_t t;
+    void * ret;
+
+    pthread_create(&t, NULL, exit_early, &one);
+    pthread_join(t, &ret);
+    assert(ret == &one);
+
+    pthread_create(&t, NULL, outlive_main, NULL);
+    pthread_exit(NULL);
+}
@@ -0,0 +1,30 @@
+#include <assert.h>
+#include <pthread.h>
+
+#define THREADS 300
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+
+static int counter = 0;
+
+static void * worker(void * arg) {
+    pthread_mutex_lock(&mu);
+    counter += 1;
+    pthread_mutex_unlock(&mu);
+
+    return NULL;
+}
+
+// More threads than fit in one chunk of the thread table.
+int main(void) {
+    for (int i = 0; i < THREADS; i++) {
+        pthread_t t;
+
+        pthread_create(&t, NULL, worker, NULL);
+        pthread_join(t, NULL);
+    }
+
+    assert(counter == THREADS);
+
+    return 0;
+}
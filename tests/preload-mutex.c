@@ -0,0 +1,44 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static int counter = 0;
+static int done = 0;
+
+static void * thread_main(void * arg) {
+    pthread_mutex_lock(&mu);
+    counter += * (int *) arg;
+    done += 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mu);
+
+    return arg;
+}
+
+int main(void) {
+    pthread_t t0;
+    pthread_t t1;
+
+    int one = 1;
+    int two = 2;
+
+    pthread_create(&t0, NULL, thread_main, &one);
+    pthread_create(&t1, NULL, thread_main, &two);
+
+    pthread_mutex_lock(&mu);
+    while (done < 2)
+        pthread_cond_wait(&cond, &mu);
+    pthread_mutex_unlock(&mu);
+
+    void * ret;
+    pthread_join(t0, &ret);
+    assert(ret == &one);
+    pthread_join(t1, NULL);
+
+    assert(counter == 3);
+
+    return 0;
+}
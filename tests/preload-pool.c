@@ -0,0 +1,32 @@
+#include <pthread.h>
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static int jobs = 0;
+
+// Never returns; the process ends when `main` does.
+static void * worker_main(void * arg) {
+    while (1) {
+        pthread_mutex_lock(&mu);
+        while (jobs == 0)
+            pthread_cond_wait(&cond, &mu);
+        jobs -= 1;
+        pthread_mutex_unlock(&mu);
+    }
+
+    return NULL;
+}
+
+int main(void) {
+    pthread_t worker;
+
+    pthread_create(&worker, NULL, worker_main, NULL);
+
+    pthread_mutex_lock(&mu);
+    jobs += 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mu);
+
+    return 0;
+}
@@ -2,8 +2,23 @@
 
 set -euo pipefail
 
+preload=build/lib/libcilk-preload.so
+
+ok() {
+    printf "$(tput setaf 2)OK$(tput sgr0)\n"
+}
+
+failed() {
+    printf "$(tput setaf 1)Failed$(tput sgr0)\n"
+}
+
+# Prints the number of executions an exploration logged to the given stderr.
+executions() {
+    sed -n 's/^\[cilk\] Exploration stopped: \([0-9]*\) execution(s).*/\1/p' "$1"
+}
+
 for test in build/tests/test-*; do
-    if [[ ! -f "$test" ]]; then
+    if [[ ! -f "$test" || "$test" == *.stderr ]]; then
         continue
     fi
 
@@ -23,3 +38,140 @@ for test in build/tests/test-*; do
         printf "$(tput setaf 1)Failed$(tput sgr0)\n"
     fi
 done
+
+for test in build/tests/preload-*; do
+    if [[ ! -f "$test" || "$test" == *.stderr || "$test" == build/tests/preload-bug-* ]]; then
+        continue
+    fi
+
+    test_name=${test#"build/tests/preload-"}
+
+    printf "Running preload test: $test_name ... "
+
+    if LD_PRELOAD=$preload ${test} 2> "$test.stderr"; then
+        ok
+    else
+        failed
+    fi
+done
+
+for test in build/tests/bug-*; do
+    if [[ ! -f "$test" || "$test" == *.stderr ]]; then
+        continue
+    fi
+
+    test_name=${test#"build/tests/bug-"}
+
+    for symmetry in off arg routine; do
+        printf "Running bug test: $test_name ($symmetry symmetry) ... "
+
+        # The subshell keeps bash from reporting the expected abort.
+        if (CILK_STRATEGY=dfs CILK_SYMMETRY=$symmetry LD_LIBRARY_PATH=build/lib ${test} 2> "$test.stderr"; exit $?) 2> /dev/null; then
+            failed
+        else
+            ok
+        fi
+    done
+done
+
+for test in build/tests/preload-bug-*; do
+    if [[ ! -f "$test" || "$test" == *.stderr ]]; then
+        continue
+    fi
+
+    test_name=${test#"build/tests/preload-bug-"}
+
+    printf "Running preload bug test: $test_name ... "
+
+    if (CILK_STRATEGY=dfs LD_PRELOAD=$preload ${test} 2> "$test.stderr"; exit $?) 2> /dev/null; then
+        failed
+    else
+        ok
+    fi
+done
+
+printf "Running case: symmetry ... "
+
+CILK_STRATEGY=dfs CILK_SYMMETRY=off LD_LIBRARY_PATH=build/lib build/tests/test-thread 2> build/tests/symmetry-off.stderr
+CILK_STRATEGY=dfs CILK_SYMMETRY=routine LD_LIBRARY_PATH=build/lib build/tests/test-thread 2> build/tests/symmetry-routine.stderr
+
+if (( $(executions build/tests/symmetry-routine.stderr) < $(executions build/tests/symmetry-off.stderr) )); then
+    ok
+else
+    failed
+fi
+
+printf "Running case: dfs ... "
+
+if CILK_STRATEGY=dfs LD_LIBRARY_PATH=build/lib build/tests/test-thread 2> build/tests/dfs.stderr \
+    && grep -q "0 unexplored branch(es)" build/tests/dfs.stderr \
+    && (( $(executions build/tests/dfs.stderr) > 1 )); then
+    ok
+else
+    failed
+fi
+
+# A checkpointed run and the rest of its frontier, resumed whole or in
+# shards, add up to one full exploration.
+explore() {
+    CILK_STRATEGY=dfs LD_PRELOAD=$preload build/tests/preload-mutex 2> "build/tests/$1.stderr"
+    executions "build/tests/$1.stderr"
+}
+
+printf "Running case: checkpoint ... "
+
+rm -f build/tests/checkpoint
+full=$(explore full)
+checkpointed=$(CILK_ITERATIONS=10 CILK_CHECKPOINT=build/tests/checkpoint explore checkpointed)
+resumed=$(CILK_RESUME=build/tests/checkpoint explore resumed)
+sharded=0
+for shard in 0 1 2; do
+    sharded=$(( sharded + $(CILK_RESUME=build/tests/checkpoint CILK_SHARD=$shard/3 explore shard-$shard) ))
+done
+
+if (( checkpointed == 10 && checkpointed + resumed == full && sharded == resumed )); then
+    ok
+else
+    failed
+fi
+
+printf "Running case: corpus ... "
+
+rm -rf build/tests/corpus
+CILK_STRATEGY=fuzz CILK_ITERATIONS=100 CILK_CORPUS=build/tests/corpus LD_PRELOAD=$preload build/tests/preload-mutex 2> build/tests/corpus.stderr
+CILK_STRATEGY=fuzz CILK_ITERATIONS=1 CILK_CORPUS=build/tests/corpus LD_PRELOAD=$preload build/tests/preload-mutex 2> build/tests/corpus.stderr
+
+schedules=$(find build/tests/corpus -name 'schedule-*' | wc -l)
+
+if (( schedules > 0 )) && grep -q "Loaded $schedules schedule(s)" build/tests/corpus.stderr; then
+    ok
+else
+    failed
+fi
+
+printf "Running case: stale corpus ... "
+
+# A seed recorded against another version of the program must not end the run.
+rm -rf build/tests/stale
+mkdir build/tests/stale
+echo 1/5 > build/tests/stale/schedule-stale
+
+if CILK_STRATEGY=fuzz CILK_ITERATIONS=10 CILK_CORPUS=build/tests/stale LD_PRELOAD=$preload build/tests/preload-mutex 2> build/tests/stale.stderr \
+    && grep -q "Fuzzing done: 10 execution(s)" build/tests/stale.stderr; then
+    ok
+else
+    failed
+fi
+
+printf "Running case: crash replay ... "
+
+rm -rf build/tests/crashes
+
+if (CILK_STRATEGY=fuzz CILK_SEED=1 CILK_ITERATIONS=1000 CILK_CORPUS=build/tests/crashes LD_LIBRARY_PATH=build/lib build/tests/bug-ticket 2> build/tests/crashes.stderr; exit $?) 2> /dev/null; then
+    failed
+elif crash=$(find build/tests/crashes -name 'crash-*' | head -n 1) && [[ -n "$crash" ]] \
+    && ! (CILK_REPLAY=$crash LD_LIBRARY_PATH=build/lib build/tests/bug-ticket 2> build/tests/replay.stderr; exit $?) 2> /dev/null; then
+    ok
+else
+    failed
+fi